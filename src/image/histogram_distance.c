@@ -0,0 +1,156 @@
+/*
+* filename: histogram_distance.c
+* author: Lars Vidar Magnusson <lars.v.magnusson@hiof.no>
+*
+* This file provides distance kernels for stacks of one-dimensional
+* histograms. The histograms are stored contiguously, and the distance
+* between every pair of histograms in two stacks is computed in one call.
+* The sums run over independent lanes that are added together at the end,
+* and the loops are free of branches, which lets the compiler keep the inner
+* loops in vector registers without reordering floating point operations.
+* The loops are only vectorised from -O3, so the Makefile compiles this file
+* on its own instead of passing it to MLton.
+*/
+
+#include <stdint.h>
+#include <math.h>
+
+#include "../ffi.h"
+
+#define LANES 4
+
+/*
+* The masked division in the chi-squared loop is only vectorised when the
+* compiler may assume that floating point operations do not trap.
+*/
+#if defined(__GNUC__) && !defined(__clang__)
+#define NO_TRAPPING_MATH __attribute__((optimize("no-trapping-math")))
+#else
+#define NO_TRAPPING_MATH
+#endif
+
+#define CHI_SQUARED 0
+#define L1 1
+#define EARTH_MOVERS 2
+
+static double sum(const double *restrict h, int32_t bins) {
+  double lanes[LANES] = { 0.0, 0.0, 0.0, 0.0 };
+  int32_t i, l;
+
+  for (i = 0; i+LANES <= bins; i += LANES)
+    for (l = 0; l < LANES; l++)
+      lanes[l] += h[i+l];
+  for (; i < bins; i++)
+    lanes[0] += h[i];
+
+  return (lanes[0]+lanes[1])+(lanes[2]+lanes[3]);
+}
+
+/*
+* The normalisation factor of a histogram, which leaves empty histograms
+* empty.
+*/
+static double scale(const double *restrict h, int32_t bins, int32_t normalise) {
+  double s;
+
+  if (!normalise)
+    return 1.0;
+  s = sum(h, bins);
+  return s > 0.0 ? 1.0/s : 1.0;
+}
+
+NO_TRAPPING_MATH
+static double chiSquared(const double *restrict a, const double *restrict b,
+                         int32_t bins, double sa, double sb, double epsilon) {
+  double lanes[LANES] = { 0.0, 0.0, 0.0, 0.0 };
+  int32_t i, l;
+
+  for (i = 0; i+LANES <= bins; i += LANES)
+    for (l = 0; l < LANES; l++) {
+      double x = a[i+l]*sa;
+      double y = b[i+l]*sb;
+      double s = x+y;
+      double d = x-y;
+      double m = (double)(s > epsilon);
+      lanes[l] += m*(d*d/(m*s+(1.0-m)));
+    }
+  for (; i < bins; i++) {
+    double x = a[i]*sa;
+    double y = b[i]*sb;
+    double s = x+y;
+    double d = x-y;
+    lanes[0] += s > epsilon ? d*d/s : 0.0;
+  }
+
+  return 0.5*((lanes[0]+lanes[1])+(lanes[2]+lanes[3]));
+}
+
+static double l1(const double *restrict a, const double *restrict b,
+                 int32_t bins, double sa, double sb) {
+  double lanes[LANES] = { 0.0, 0.0, 0.0, 0.0 };
+  int32_t i, l;
+
+  for (i = 0; i+LANES <= bins; i += LANES)
+    for (l = 0; l < LANES; l++)
+      lanes[l] += fabs(a[i+l]*sa-b[i+l]*sb);
+  for (; i < bins; i++)
+    lanes[0] += fabs(a[i]*sa-b[i]*sb);
+
+  return (lanes[0]+lanes[1])+(lanes[2]+lanes[3]);
+}
+
+/*
+* The earth mover's distance between one-dimensional histograms with unit
+* ground distance between neighbouring bins, which is the L1 distance
+* between the cumulative histograms.
+*/
+static double earthMovers(const double *restrict a, const double *restrict b,
+                          int32_t bins, double sa, double sb) {
+  double cumulative = 0.0;
+  double distance = 0.0;
+  int32_t i;
+
+  for (i = 0; i < bins; i++) {
+    cumulative += a[i]*sa-b[i]*sb;
+    distance += fabs(cumulative);
+  }
+
+  return distance;
+}
+
+/*
+* Compute the distance between histogram k of the first stack and histogram
+* k of the second stack for every k below count, and store it at index k of
+* the output. When normalise is set, every histogram is divided by its sum
+* before the distance is computed. The chi-squared terms where the sum of
+* the two bins is not above epsilon are left out.
+*/
+void fiHistogramDistances(int32_t distance,
+                          Pointer stack1, Pointer stack2,
+                          int32_t bins, int32_t count,
+                          int32_t normalise, double epsilon,
+                          Pointer output) {
+  const double *a = (const double *)stack1;
+  const double *b = (const double *)stack2;
+  double *out = (double *)output;
+  int32_t k;
+
+  for (k = 0; k < count; k++) {
+    const double *ha = a+(int64_t)k*bins;
+    const double *hb = b+(int64_t)k*bins;
+    double sa = scale(ha, bins, normalise);
+    double sb = scale(hb, bins, normalise);
+
+    switch (distance) {
+    case CHI_SQUARED:
+      out[k] = chiSquared(ha, hb, bins, sa, sb, epsilon);
+      break;
+    case L1:
+      out[k] = l1(ha, hb, bins, sa, sb);
+      break;
+    default:
+      out[k] = earthMovers(ha, hb, bins, sa, sb);
+      break;
+    }
+  }
+}